@@ -1,3 +1,4 @@
+#include <intrin.h>
 #include "cautil.h"
 #include "dl.h"
 #include "bitstream.h"
@@ -95,6 +96,27 @@ namespace cautil {
         *size = 0;
         if (q < end) {
             *tag = *q++;
+            if (end - q >= 4) {
+                /*
+                 * Common case: the variable length size fits in the next
+                 * 4 bytes. Locate the terminator (high bit clear) with one
+                 * bit scan and gather the big-endian 7-bit groups
+                 * branchlessly instead of a loop-carried shift/or.
+                 */
+                uint32_t v;
+                std::memcpy(&v, q, 4);
+                unsigned long idx;
+                if (_BitScanForward(&idx, ~v & 0x80808080)) {
+                    unsigned len = (idx >> 3) + 1;
+                    uint32_t w = util::b2host32(v) >> (8 * (4 - len));
+                    *size = (w         & 0x0000007f)
+                          | ((w >> 1)  & 0x00003f80)
+                          | ((w >> 2)  & 0x001fc000)
+                          | ((w >> 3)  & 0x0fe00000);
+                    return q + len;
+                }
+                /* size field longer than 4 bytes: overflow, as before */
+            }
             while (q < end) {
                 int n = *q++;
                 *size = (*size << 7) | (n & 0x7f);
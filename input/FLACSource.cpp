@@ -1,4 +1,4 @@
-#include <functional>
+#include <intrin.h>
 #include "FLACSource.h"
 #include "strutil.h"
 #include "metadata.h"
@@ -6,6 +6,23 @@
 #include "win32util.h"
 #include "chanmap.h"
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+#define QAAC_FLAC_SSE2 1
+#include <emmintrin.h>
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+#define QAAC_FLAC_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+#ifdef __GNUC__
+#define TARGET_AVX2 __attribute__((__target__("avx2")))
+#define TARGET_XSAVE __attribute__((__target__("xsave")))
+#else
+#define TARGET_AVX2
+#define TARGET_XSAVE
+#endif
+
 namespace flac {
     template <typename T> void try__(T expr, const char *msg)
     {
@@ -24,43 +41,313 @@ namespace flac {
         want(si.channels > 0 && si.channels < 9);
         want(si.bits_per_sample >= 8 && si.bits_per_sample <= 32);
     }
+
+    /*
+     * Postprocess of a decoded frame: shift samples to MSB side and
+     * interleave the planar channel buffers handed to us by libFLAC.
+     * Kernels share one signature so they can sit in the dispatch
+     * table below; mono/stereo ones simply ignore nchannels.
+     */
+    typedef void (*shift_interleave_t)(int32_t *dst,
+                                       const FLAC__int32 *const *src,
+                                       unsigned nchannels, size_t nsamples,
+                                       unsigned shift);
+
+    void shift_interleave_scalar(int32_t *dst, const FLAC__int32 *const *src,
+                                 unsigned nchannels, size_t nsamples,
+                                 unsigned shift)
+    {
+        for (size_t i = 0; i < nsamples; ++i)
+            for (unsigned n = 0; n < nchannels; ++n)
+                *dst++ = (src[n][i] << shift);
+    }
+
+#ifdef QAAC_FLAC_SSE2
+    void shift_interleave_mono_sse2(int32_t *dst,
+                                    const FLAC__int32 *const *src,
+                                    unsigned nchannels, size_t nsamples,
+                                    unsigned shift)
+    {
+        __m128i cnt = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 4 <= nsamples; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>
+                                        (&src[0][i]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                             _mm_sll_epi32(v, cnt));
+        }
+        for (; i < nsamples; ++i)
+            dst[i] = (src[0][i] << shift);
+    }
+
+    void shift_interleave_stereo_sse2(int32_t *dst,
+                                      const FLAC__int32 *const *src,
+                                      unsigned nchannels, size_t nsamples,
+                                      unsigned shift)
+    {
+        __m128i cnt = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 4 <= nsamples; i += 4) {
+            __m128i l =
+                _mm_sll_epi32(_mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(&src[0][i])), cnt);
+            __m128i r =
+                _mm_sll_epi32(_mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(&src[1][i])), cnt);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i),
+                             _mm_unpacklo_epi32(l, r));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i + 4),
+                             _mm_unpackhi_epi32(l, r));
+        }
+        for (; i < nsamples; ++i) {
+            dst[2 * i]     = (src[0][i] << shift);
+            dst[2 * i + 1] = (src[1][i] << shift);
+        }
+    }
+
+    /*
+     * Multichannel (4ch and up) variant: shift 4 samples of 4 channels,
+     * transpose the 4x4 block in registers and store whole frames.
+     * When alignment permits, use nontemporal stores so the
+     * intermediate buffer does not thrash the cache.
+     */
+    void shift_interleave_multi_sse2(int32_t *dst,
+                                     const FLAC__int32 *const *src,
+                                     unsigned nchannels, size_t nsamples,
+                                     unsigned shift)
+    {
+        __m128i cnt = _mm_cvtsi32_si128(shift);
+        /*
+         * movntdq needs 16 byte alignment; every output row keeps it
+         * only when the frame stride is a multiple of 4 samples.
+         */
+        bool stream = nchannels % 4 == 0
+                   && !(reinterpret_cast<uintptr_t>(dst) & 15);
+        size_t i = 0;
+        for (; i + 4 <= nsamples; i += 4) {
+            for (unsigned g = 0; g + 4 <= nchannels; g += 4) {
+                __m128i a =
+                    _mm_sll_epi32(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&src[g][i])), cnt);
+                __m128i b =
+                    _mm_sll_epi32(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&src[g+1][i])), cnt);
+                __m128i c =
+                    _mm_sll_epi32(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&src[g+2][i])), cnt);
+                __m128i d =
+                    _mm_sll_epi32(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(&src[g+3][i])), cnt);
+                __m128i ab_lo = _mm_unpacklo_epi32(a, b); /* a0 b0 a1 b1 */
+                __m128i ab_hi = _mm_unpackhi_epi32(a, b); /* a2 b2 a3 b3 */
+                __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+                __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+                __m128i r0 = _mm_unpacklo_epi64(ab_lo, cd_lo);
+                __m128i r1 = _mm_unpackhi_epi64(ab_lo, cd_lo);
+                __m128i r2 = _mm_unpacklo_epi64(ab_hi, cd_hi);
+                __m128i r3 = _mm_unpackhi_epi64(ab_hi, cd_hi);
+                int32_t *op = dst + i * nchannels + g;
+                if (stream) {
+                    _mm_stream_si128(reinterpret_cast<__m128i*>(op), r0);
+                    _mm_stream_si128(reinterpret_cast<__m128i*>
+                                     (op + nchannels), r1);
+                    _mm_stream_si128(reinterpret_cast<__m128i*>
+                                     (op + 2 * nchannels), r2);
+                    _mm_stream_si128(reinterpret_cast<__m128i*>
+                                     (op + 3 * nchannels), r3);
+                } else {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(op), r0);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>
+                                     (op + nchannels), r1);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>
+                                     (op + 2 * nchannels), r2);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>
+                                     (op + 3 * nchannels), r3);
+                }
+            }
+            for (unsigned n = nchannels & ~3u; n < nchannels; ++n)
+                for (unsigned k = 0; k < 4; ++k)
+                    dst[(i + k) * nchannels + n] = (src[n][i + k] << shift);
+        }
+        for (; i < nsamples; ++i)
+            for (unsigned n = 0; n < nchannels; ++n)
+                dst[i * nchannels + n] = (src[n][i] << shift);
+        if (stream)
+            _mm_sfence();
+    }
+#endif
+
+#ifdef QAAC_FLAC_AVX2
+    TARGET_AVX2
+    void shift_interleave_mono_avx2(int32_t *dst,
+                                    const FLAC__int32 *const *src,
+                                    unsigned nchannels, size_t nsamples,
+                                    unsigned shift)
+    {
+        __m128i cnt = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 8 <= nsamples; i += 8) {
+            __m256i v =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>
+                                   (&src[0][i]));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                                _mm256_sll_epi32(v, cnt));
+        }
+        for (; i < nsamples; ++i)
+            dst[i] = (src[0][i] << shift);
+    }
+
+    TARGET_AVX2
+    void shift_interleave_stereo_avx2(int32_t *dst,
+                                      const FLAC__int32 *const *src,
+                                      unsigned nchannels, size_t nsamples,
+                                      unsigned shift)
+    {
+        __m128i cnt = _mm_cvtsi32_si128(shift);
+        size_t i = 0;
+        for (; i + 8 <= nsamples; i += 8) {
+            __m256i l =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>
+                                   (&src[0][i]));
+            __m256i r =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>
+                                   (&src[1][i]));
+            l = _mm256_sll_epi32(l, cnt);
+            r = _mm256_sll_epi32(r, cnt);
+            /* lo: L0 R0 L1 R1 | L4 R4 L5 R5 */
+            __m256i lo = _mm256_unpacklo_epi32(l, r);
+            /* hi: L2 R2 L3 R3 | L6 R6 L7 R7 */
+            __m256i hi = _mm256_unpackhi_epi32(l, r);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i),
+                                _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i + 8),
+                                _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+        for (; i < nsamples; ++i) {
+            dst[2 * i]     = (src[0][i] << shift);
+            dst[2 * i + 1] = (src[1][i] << shift);
+        }
+    }
+
+    TARGET_XSAVE
+    bool have_avx2()
+    {
+        static int result = -1;
+        if (result < 0) {
+            int regs[4];
+            result = 0;
+            __cpuid(regs, 0);
+            if (regs[0] >= 7) {
+                __cpuid(regs, 1);
+                /* OSXSAVE and AVX, then YMM state enabled by the OS */
+                if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28))
+                 && (_xgetbv(0) & 6) == 6) {
+                    __cpuidex(regs, 7, 0);
+                    if (regs[1] & (1 << 5))
+                        result = 1;
+                }
+            }
+        }
+        return result > 0;
+    }
+#endif
+
+    /*
+     * Dispatch table picked once per process from cpuid, in the same
+     * spirit as FFmpeg's FLACDSPContext/ff_flacdsp_init_x86. AVX-512
+     * tier is left out: the oldest toolset this project still builds
+     * with does not ship the 512-bit intrinsics.
+     */
+    struct PostProc {
+        shift_interleave_t mono;
+        shift_interleave_t stereo;
+        shift_interleave_t multi;
+        PostProc(): mono(shift_interleave_scalar),
+                    stereo(shift_interleave_scalar),
+                    multi(shift_interleave_scalar)
+        {
+#ifdef QAAC_FLAC_SSE2
+            mono   = shift_interleave_mono_sse2;
+            stereo = shift_interleave_stereo_sse2;
+            multi  = shift_interleave_multi_sse2;
+#endif
+#ifdef QAAC_FLAC_AVX2
+            if (have_avx2()) {
+                mono   = shift_interleave_mono_avx2;
+                stereo = shift_interleave_stereo_avx2;
+            }
+#endif
+        }
+    };
+
+    void shift_interleave(int32_t *dst, const FLAC__int32 *const *src,
+                          unsigned nchannels, size_t nsamples, unsigned shift)
+    {
+        static PostProc pp;
+        shift_interleave_t fn = nchannels == 1 ? pp.mono
+                              : nchannels == 2 ? pp.stereo
+                              : pp.multi;
+        fn(dst, src, nchannels, nsamples, shift);
+    }
 }
 #define TRYFL(expr) (void)(flac::try__((expr), #expr))
 
-FLACSource::FLACSource(const std::shared_ptr<FILE> &fp):
+FLACSource::FLACSource(const std::shared_ptr<FILE> &fp, bool want_tags):
     m_eof(false),
     m_giveup(false),
     m_initialize_done(false),
     m_length(0),
     m_position(0),
     m_fp(fp),
+    m_io_buffer(1 << 18),
+    m_io_pos(0),
+    m_io_buf_off(0),
+    m_io_buf_len(0),
+    m_io_length(-1),
+    m_plane_cap(0),
+    m_pcm_pos(0),
+    m_pcm_count(0),
+    m_direct_out(0),
+    m_direct_cap(0),
+    m_direct_filled(0),
     m_module(FLACModule::instance())
 {
     if (!m_module.loaded()) throw std::runtime_error("libFLAC not loaded");
     char buffer[33];
     util::check_eof(util::nread(fileno(m_fp.get()), buffer, 33) == 33);
     if (std::memcmp(buffer, "ID3", 3) == 0) {
-        uint32_t size = 0;
-        for (int i = 6; i < 10; ++i) {
-            size <<= 7;
-            size |= buffer[i];
-        }
+        /*
+         * ID3v2 synchsafe size: 4 big-endian bytes carrying 7 bits each.
+         * Gather the 7-bit groups of a single 32-bit load instead of a
+         * loop-carried shift/or.
+         */
+        uint32_t v;
+        std::memcpy(&v, buffer + 6, 4);
+        v = util::b2host32(v);
+        uint32_t size = (v         & 0x0000007f)
+                      | ((v >> 1)  & 0x00003f80)
+                      | ((v >> 2)  & 0x001fc000)
+                      | ((v >> 3)  & 0x0fe00000);
         CHECKCRT(_lseeki64(fileno(m_fp.get()), 10 + size, SEEK_SET) < 0);
         util::check_eof(util::nread(fileno(m_fp.get()), buffer, 33) == 33);
     }
     uint32_t fcc = util::fourcc(buffer);
     if ((fcc != 'fLaC' && fcc != 'OggS')
-     || (fcc == 'OggS' && std::memcmp(&buffer[28], "\177FLAC", 5)))
+     || (fcc == 'OggS'
+         && (uint32_t(util::fourcc(&buffer[28])) != FOURCC('\177','F','L','A')
+             || buffer[32] != 'C')))
         throw std::runtime_error("Not a FLAC file");
     CHECKCRT(_lseeki64(fileno(m_fp.get()), 0, SEEK_SET) < 0);
 
     m_decoder =
         decoder_t(m_module.stream_decoder_new(),
-                  std::bind1st(std::mem_fun(&FLACSource::close), this));
-    TRYFL(m_module.stream_decoder_set_metadata_respond(
-                m_decoder.get(), FLAC__METADATA_TYPE_VORBIS_COMMENT));
-    TRYFL(m_module.stream_decoder_set_metadata_respond(
-                m_decoder.get(), FLAC__METADATA_TYPE_PICTURE));
+                  [this](FLAC__StreamDecoder *d) { close(d); });
+    if (want_tags) {
+        TRYFL(m_module.stream_decoder_set_metadata_respond(
+                    m_decoder.get(), FLAC__METADATA_TYPE_VORBIS_COMMENT));
+        TRYFL(m_module.stream_decoder_set_metadata_respond(
+                    m_decoder.get(), FLAC__METADATA_TYPE_PICTURE));
+    }
 
     TRYFL((fcc == 'OggS' ? m_module.stream_decoder_init_ogg_stream
                          : m_module.stream_decoder_init_stream)
@@ -78,7 +365,6 @@ FLACSource::FLACSource(const std::shared_ptr<FILE> &fp):
                 m_decoder.get()));
     if (m_giveup || m_asbd.mBitsPerChannel == 0)
         flac::want(false);
-    m_buffer.set_unit(m_asbd.mChannelsPerFrame);
     m_initialize_done = true;
 }
 
@@ -86,7 +372,8 @@ void FLACSource::seekTo(int64_t count)
 {
     if (count == m_position)
         return;
-    m_buffer.reset();
+    m_pcm_pos = m_pcm_count = 0;
+    m_direct_out = 0;
     TRYFL(m_module.stream_decoder_seek_absolute(m_decoder.get(), count));
     m_position = count;
 }
@@ -95,30 +382,83 @@ size_t FLACSource::readSamples(void *buffer, size_t nsamples)
 {
     if (m_giveup)
         throw std::runtime_error("FLAC decoder error");
-    if (!m_buffer.count()) {
-        if (m_module.stream_decoder_get_state(m_decoder.get()) ==
-                FLAC__STREAM_DECODER_END_OF_STREAM)
-            return 0;
-        TRYFL(m_module.stream_decoder_process_single(m_decoder.get()));
-    }
-    uint32_t count = std::min(m_buffer.count(), nsamples);
-    if (count) {
-        uint32_t bytes = count * m_asbd.mChannelsPerFrame * 4;
-        std::memcpy(buffer, m_buffer.read(count), bytes);
-        m_position += count;
+    int32_t *bp = static_cast<int32_t *>(buffer);
+    size_t rest = nsamples;
+    unsigned nchannels = m_asbd.mChannelsPerFrame;
+    while (rest > 0) {
+        if (m_pcm_count) {
+            size_t count = std::min(m_pcm_count, rest);
+            const FLAC__int32 *planes[8];
+            for (unsigned n = 0; n < nchannels; ++n)
+                planes[n] = &m_pcm[n * m_plane_cap + m_pcm_pos];
+            flac::shift_interleave(bp, planes, nchannels, count,
+                                   32 - m_asbd.mBitsPerChannel);
+            m_pcm_pos += count;
+            m_pcm_count -= count;
+            bp += count * nchannels;
+            rest -= count;
+        } else {
+            if (m_module.stream_decoder_get_state(m_decoder.get()) ==
+                    FLAC__STREAM_DECODER_END_OF_STREAM)
+                break;
+            /*
+             * Let writeCallback() fill the caller's buffer directly when
+             * the next frame fits into it, saving a trip through the
+             * stash.
+             */
+            m_direct_out = bp;
+            m_direct_cap = rest;
+            m_direct_filled = 0;
+            TRYFL(m_module.stream_decoder_process_single(m_decoder.get()));
+            m_direct_out = 0;
+            if (m_giveup)
+                throw std::runtime_error("FLAC decoder error");
+            if (m_direct_filled) {
+                bp += m_direct_filled * nchannels;
+                rest -= m_direct_filled;
+            }
+        }
     }
-    return count;
+    size_t total = nsamples - rest;
+    m_position += total;
+    return total;
+}
+
+bool FLACSource::refillIOBuffer()
+{
+    if (_lseeki64(fileno(m_fp.get()), m_io_pos, SEEK_SET) < 0)
+        return false;
+    ssize_t n = util::nread(fileno(m_fp.get()), &m_io_buffer[0],
+                            m_io_buffer.size());
+    if (n <= 0)
+        return false;
+    m_io_buf_off = m_io_pos;
+    m_io_buf_len = n;
+    return true;
 }
 
 FLAC__StreamDecoderReadStatus
 FLACSource::readCallback(FLAC__byte *buffer, size_t *bytes)
 {
-    ssize_t n = util::nread(fileno(m_fp.get()), buffer, *bytes);
-    if (n <= 0) {
+    size_t want = *bytes;
+    size_t total = 0;
+    while (total < want) {
+        if (m_io_pos < m_io_buf_off
+         || m_io_pos >= m_io_buf_off + static_cast<int64_t>(m_io_buf_len)) {
+            if (!refillIOBuffer())
+                break;
+        }
+        size_t off = m_io_pos - m_io_buf_off;
+        size_t n = std::min(want - total, m_io_buf_len - off);
+        std::memcpy(buffer + total, &m_io_buffer[off], n);
+        total += n;
+        m_io_pos += n;
+    }
+    if (!total) {
         m_eof = true;
         return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
     }
-    *bytes = n;
+    *bytes = total;
     return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
 
@@ -126,29 +466,26 @@ FLAC__StreamDecoderSeekStatus
 FLACSource::seekCallback(uint64_t offset)
 {
     m_eof = false;
-    if (_lseeki64(fileno(m_fp.get()), offset, SEEK_SET) == offset)
-        return FLAC__STREAM_DECODER_SEEK_STATUS_OK; 
-    else
-        return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR; 
+    /* just move the logical position; the buffer window is refilled lazily */
+    m_io_pos = offset;
+    return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
 }
 
 FLAC__StreamDecoderTellStatus
 FLACSource::tellCallback(uint64_t *offset)
 {
-    int64_t off = _lseeki64(fileno(m_fp.get()), 0, SEEK_CUR);
-    if (off < 0)
-        return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
-    *offset = off;
+    *offset = m_io_pos;
     return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
 FLAC__StreamDecoderLengthStatus
 FLACSource::lengthCallback(uint64_t *length)
 {
-    int64_t len = _filelengthi64(fileno(m_fp.get()));
-    if (len < 0)
+    if (m_io_length < 0)
+        m_io_length = _filelengthi64(fileno(m_fp.get()));
+    if (m_io_length < 0)
         return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
-    *length = len;
+    *length = m_io_length;
     return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
 }
 
@@ -172,12 +509,32 @@ FLACSource::writeCallback( const FLAC__Frame *frame,
      * shifting to MSB side.
      */
     uint32_t shifts = 32 - h.bits_per_sample;
-    m_buffer.reserve(h.blocksize);
-    int32_t *bp = m_buffer.write_ptr();
-    for (size_t i = 0; i < h.blocksize; ++i)
-        for (size_t n = 0; n < h.channels; ++n)
-            *bp++ = (buffer[n][i] << shifts);
-    m_buffer.commit(h.blocksize);
+    if (m_direct_out && h.blocksize <= m_direct_cap) {
+        flac::shift_interleave(m_direct_out, buffer,
+                               h.channels, h.blocksize, shifts);
+        /*
+         * Stay armed: if the decoder hands us several frames per process
+         * call (seek preroll does), they all land in the caller's buffer
+         * back to back without a stash round trip.
+         */
+        m_direct_out += h.blocksize * h.channels;
+        m_direct_cap -= h.blocksize;
+        m_direct_filled += h.blocksize;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+    /*
+     * Stash the frame as-is in planar layout; we only ever decode with
+     * the stash drained, so the planes are free.
+     */
+    if (h.blocksize > m_plane_cap) {
+        m_plane_cap = h.blocksize;
+        m_pcm.resize(m_plane_cap * h.channels);
+    }
+    for (unsigned n = 0; n < h.channels; ++n)
+        std::memcpy(&m_pcm[n * m_plane_cap], buffer[n],
+                    h.blocksize * sizeof(int32_t));
+    m_pcm_pos = 0;
+    m_pcm_count = h.blocksize;
 
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -211,12 +568,25 @@ void FLACSource::handleStreamInfo(const FLAC__StreamMetadata_StreamInfo &si)
     m_asbd = cautil::buildASBDForPCM2(si.sample_rate, si.channels,
                                       si.bits_per_sample, 32,
                                       kAudioFormatFlagIsSignedInteger);
+    /*
+     * STREAMINFO tells us the largest frame we will ever see, so the
+     * planar stash can be sized once here instead of growing on the
+     * hot path.
+     */
+    m_plane_cap = si.max_blocksize;
+    m_pcm.resize(m_plane_cap * si.channels);
 }
 
 void FLACSource::handleVorbisComment(
         const FLAC__StreamMetadata_VorbisComment &vc)
 {
-    std::map<std::string, std::string> tags(m_tags);
+    /*
+     * Gather the comments into a flat vector first; paying for a
+     * red-black tree node per comment is needlessly allocation heavy.
+     */
+    typedef std::pair<std::string, std::string> entry_t;
+    std::vector<entry_t> comments;
+    comments.reserve(vc.num_comments);
     for (size_t i = 0; i < vc.num_comments; ++i) {
         const char *cs = reinterpret_cast<const char *>(vc.comments[i].entry);
         strutil::Tokenizer<char> tokens(cs, "=");
@@ -227,9 +597,21 @@ void FLACSource::handleVorbisComment(
             if (sscanf(value, "%i", &mask) == 1)
                 m_chanmap = chanmap::getChannels(mask);
         } else if (value) {
-            tags[key] = value;
+            comments.push_back(entry_t(key, value));
         }
     }
+    std::stable_sort(comments.begin(), comments.end(),
+                     [](const entry_t &a, const entry_t &b) {
+                         return a.first < b.first;
+                     });
+    std::map<std::string, std::string> tags(m_tags);
+    for (size_t i = 0; i < comments.size(); ++i) {
+        /* for duplicate keys the last occurrence wins, as before */
+        if (i + 1 < comments.size()
+         && comments[i].first == comments[i + 1].first)
+            continue;
+        tags[comments[i].first] = comments[i].second;
+    }
     m_tags = TextBasedTag::normalizeTags(tags);
 }
 
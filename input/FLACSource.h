@@ -16,13 +16,45 @@ class FLACSource: public ISeekableSource, public ITagParser
     uint64_t m_length;
     int64_t m_position;
     std::shared_ptr<FILE> m_fp;
+    /*
+     * User-space read buffer backing the libFLAC I/O callbacks.
+     * libFLAC reads in small chunks (frame headers, residuals); serving
+     * them from here avoids a syscall per callback.
+     */
+    std::vector<uint8_t> m_io_buffer;
+    int64_t m_io_pos;     /* logical stream position seen by libFLAC */
+    int64_t m_io_buf_off; /* stream offset of m_io_buffer[0]         */
+    size_t m_io_buf_len;  /* valid bytes in m_io_buffer              */
+    int64_t m_io_length;  /* cached file length, -1 until queried    */
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
-    util::FIFO<int32_t> m_buffer;
+    /*
+     * Leftover decoded PCM, kept in libFLAC's own planar layout
+     * (plane-major, m_plane_cap samples per channel). The MSB shift and
+     * channel interleave happen once, in readSamples(), directly into
+     * the caller's buffer.
+     */
+    std::vector<int32_t> m_pcm;
+    size_t m_plane_cap; /* samples per plane                */
+    size_t m_pcm_pos;   /* read position within the planes  */
+    size_t m_pcm_count; /* valid samples from m_pcm_pos on  */
+    /*
+     * When set, writeCallback() shifts/interleaves the decoded frame
+     * straight into this caller supplied destination instead of going
+     * through the planar stash (set up by readSamples() before decoding).
+     */
+    int32_t *m_direct_out;
+    size_t m_direct_cap;
+    size_t m_direct_filled;
     AudioStreamBasicDescription m_asbd;
     FLACModule &m_module;
 public:
-    FLACSource(const std::shared_ptr<FILE> &fp);
+    /*
+     * want_tags=false skips the VORBIS_COMMENT/PICTURE metadata blocks
+     * entirely (libFLAC won't even parse them), for callers that
+     * discard tags anyway.
+     */
+    FLACSource(const std::shared_ptr<FILE> &fp, bool want_tags=true);
     ~FLACSource() { m_decoder.reset(); }
     uint64_t length() const { return m_length; }
     const AudioStreamBasicDescription &getSampleFormat() const
@@ -108,6 +140,7 @@ private:
         FLACSource *self = reinterpret_cast<FLACSource*>(client_data);
         self->errorCallback(status);
     }
+    bool refillIOBuffer();
     FLAC__StreamDecoderReadStatus
         readCallback(FLAC__byte *buffer, size_t *bytes);
     FLAC__StreamDecoderSeekStatus seekCallback(uint64_t offset);
@@ -50,7 +50,7 @@ std::shared_ptr<ISeekableSource> InputFactory::open(const wchar_t *path)
 #ifdef QAAC
     TRY_MAKE_SHARED(ExtAFSource, fp);
 #endif
-    TRY_MAKE_SHARED(FLACSource, fp);
+    TRY_MAKE_SHARED(FLACSource, fp, m_want_tags);
     TRY_MAKE_SHARED(WavpackSource, path);
     TRY_MAKE_SHARED(TakSource, fp);
     TRY_MAKE_SHARED(LibSndfileSource, fp);
@@ -7,9 +7,11 @@ class InputFactory {
     AudioStreamBasicDescription m_raw_format;
     bool m_is_raw;
     bool m_ignore_length;
+    bool m_want_tags;
     std::map<std::wstring, std::shared_ptr<ISeekableSource> > m_sources;
 private:
-    InputFactory() : m_is_raw(false), m_ignore_length(false) {}
+    InputFactory() : m_is_raw(false), m_ignore_length(false),
+                     m_want_tags(true) {}
     InputFactory(const InputFactory&);
     InputFactory& operator=(InputFactory&);
 public:
@@ -28,6 +30,11 @@ public:
     {
         m_ignore_length = cond;
     }
+    /* opt out of metadata parsing for sources that support it */
+    void setWantTags(bool cond)
+    {
+        m_want_tags = cond;
+    }
     void close()
     {
         m_sources.clear();
@@ -71,7 +71,4 @@ namespace CAF {
     std::map<std::string, std::string> fetchTags(int fd);
 }
 
-const char * const iTunSMPB_template = " 00000000 %08X %08X %08X%08X "
-"00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000";
-
 #endif
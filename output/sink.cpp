@@ -116,8 +116,11 @@ void MP4SinkBase::writeTags()
              */
             double off = static_cast<double>(m_edit_start) / timeScale;
             std::vector<misc::chapter_t>::const_iterator chap;
+            /* reuse one UTF-8 conversion buffer over the whole loop */
+            std::string name;
             for (chap = m_chapters.begin(); chap != m_chapters.end(); ++chap) {
-                std::string name = strutil::w2us(chap->first);
+                strutil::w2m(name, chap->first.c_str(), chap->first.size(),
+                             std::codecvt_utf8<wchar_t>());
                 const char *namep = name.c_str();
                 m_mp4file.AddChapter(track, chap->second * timeScale + 0.5,
                                      namep);
@@ -193,68 +196,81 @@ void MP4SinkBase::writeBitrates(int avgBitrate)
 
 void MP4SinkBase::writeShortTag(uint32_t fcc, const std::string &value)
 {
-    struct handler_t {
-        uint32_t fcc;
-        void (MP4SinkBase::*mf)(const char *, const std::string &);
-    } handlers[] = {
-        { Tag::kAlbum,                &MP4SinkBase::writeStringTag      },
-        { Tag::kAlbumArtist,          &MP4SinkBase::writeStringTag      },
-        { Tag::kArtist,               &MP4SinkBase::writeStringTag      },
-        { Tag::kComment,              &MP4SinkBase::writeStringTag      },
-        { Tag::kComposer,             &MP4SinkBase::writeStringTag      },
-        { Tag::kCopyright,            &MP4SinkBase::writeStringTag      },
-        { Tag::kDate,                 &MP4SinkBase::writeStringTag      },
-        { Tag::kDescription,          &MP4SinkBase::writeStringTag      },
-        { Tag::kGrouping,             &MP4SinkBase::writeStringTag      },
-        { Tag::kLongDescription,      &MP4SinkBase::writeStringTag      },
-        { Tag::kLyrics,               &MP4SinkBase::writeStringTag      },
-        { Tag::kTitle,                &MP4SinkBase::writeStringTag      },
-        { Tag::kTool,                 &MP4SinkBase::writeStringTag      },
-        { Tag::kTrack,                &MP4SinkBase::writeTrackTag       },
-        { Tag::kDisk,                 &MP4SinkBase::writeDiskTag        },
-        { Tag::kGenre,                &MP4SinkBase::writeGenreTag       },
-        { Tag::kGenreID3,             &MP4SinkBase::writeGenreTag       },
-        { Tag::kCompilation,          &MP4SinkBase::writeInt8Tag        },
-        { Tag::kTempo,                &MP4SinkBase::writeInt16Tag       },
-        { Tag::kTvSeason,             &MP4SinkBase::writeInt32Tag       },
-        { Tag::kTvEpisode,            &MP4SinkBase::writeInt32Tag       },
-        { Tag::kPodcast,              &MP4SinkBase::writeInt8Tag        },
-        { Tag::kHDVideo,              &MP4SinkBase::writeInt8Tag        },
-        { Tag::kMediaType,            &MP4SinkBase::writeMediaTypeTag   },
-        { Tag::kContentRating,        &MP4SinkBase::writeRatingTag      },
-        { Tag::kGapless,              &MP4SinkBase::writeInt8Tag        },
-        { Tag::kiTunesAccountType,    &MP4SinkBase::writeAccountTypeTag },
-        { Tag::kiTunesCountry,        &MP4SinkBase::writeCountryCodeTag },
-        { Tag::kcontentID,            &MP4SinkBase::writeInt32Tag       },
-        { Tag::kartistID,             &MP4SinkBase::writeInt32Tag       },
-        { Tag::kplaylistID,           &MP4SinkBase::writeInt64Tag       },
-        { Tag::kgenreID,              &MP4SinkBase::writeInt32Tag       },
-        { Tag::kcomposerID,           &MP4SinkBase::writeInt32Tag       },
-        { 'apID',                     &MP4SinkBase::writeStringTag      },
-        { 'catg',                     &MP4SinkBase::writeStringTag      },
-        { 'keyw',                     &MP4SinkBase::writeStringTag      },
-        { 'purd',                     &MP4SinkBase::writeStringTag      },
-        { 'purl',                     &MP4SinkBase::writeStringTag      },
-        { 'soaa',                     &MP4SinkBase::writeStringTag      },
-        { 'soal',                     &MP4SinkBase::writeStringTag      },
-        { 'soar',                     &MP4SinkBase::writeStringTag      },
-        { 'soco',                     &MP4SinkBase::writeStringTag      },
-        { 'sonm',                     &MP4SinkBase::writeStringTag      },
-        { 'sosn',                     &MP4SinkBase::writeStringTag      },
-        { 'tven',                     &MP4SinkBase::writeStringTag      },
-        { 'tvnn',                     &MP4SinkBase::writeStringTag      },
-        { 'tvsh',                     &MP4SinkBase::writeStringTag      },
-        { 'xid ',                     &MP4SinkBase::writeStringTag      },
-        { FOURCC('\xa9','e','n','c'), &MP4SinkBase::writeStringTag      },
-        { 0,                          0                                 }
-    };
-
     util::fourcc fourcc(fcc);
-    for (handler_t *p = handlers; p->fcc; ++p) {
-        if (fourcc == p->fcc) {
-            (this->*p->mf)(fourcc.svalue, value);
-            return;
-        }
+    switch (fcc) {
+    case Tag::kAlbum:
+    case Tag::kAlbumArtist:
+    case Tag::kArtist:
+    case Tag::kComment:
+    case Tag::kComposer:
+    case Tag::kCopyright:
+    case Tag::kDate:
+    case Tag::kDescription:
+    case Tag::kGrouping:
+    case Tag::kLongDescription:
+    case Tag::kLyrics:
+    case Tag::kTitle:
+    case Tag::kTool:
+    case 'apID':
+    case 'catg':
+    case 'keyw':
+    case 'purd':
+    case 'purl':
+    case 'soaa':
+    case 'soal':
+    case 'soar':
+    case 'soco':
+    case 'sonm':
+    case 'sosn':
+    case 'tven':
+    case 'tvnn':
+    case 'tvsh':
+    case 'xid ':
+    case FOURCC('\xa9','e','n','c'):
+        writeStringTag(fourcc.svalue, value);
+        break;
+    case Tag::kTrack:
+        writeTrackTag(fourcc.svalue, value);
+        break;
+    case Tag::kDisk:
+        writeDiskTag(fourcc.svalue, value);
+        break;
+    case Tag::kGenre:
+    case Tag::kGenreID3:
+        writeGenreTag(fourcc.svalue, value);
+        break;
+    case Tag::kCompilation:
+    case Tag::kPodcast:
+    case Tag::kHDVideo:
+    case Tag::kGapless:
+        writeInt8Tag(fourcc.svalue, value);
+        break;
+    case Tag::kTempo:
+        writeInt16Tag(fourcc.svalue, value);
+        break;
+    case Tag::kTvSeason:
+    case Tag::kTvEpisode:
+    case Tag::kcontentID:
+    case Tag::kartistID:
+    case Tag::kgenreID:
+    case Tag::kcomposerID:
+        writeInt32Tag(fourcc.svalue, value);
+        break;
+    case Tag::kplaylistID:
+        writeInt64Tag(fourcc.svalue, value);
+        break;
+    case Tag::kMediaType:
+        writeMediaTypeTag(fourcc.svalue, value);
+        break;
+    case Tag::kContentRating:
+        writeRatingTag(fourcc.svalue, value);
+        break;
+    case Tag::kiTunesAccountType:
+        writeAccountTypeTag(fourcc.svalue, value);
+        break;
+    case Tag::kiTunesCountry:
+        writeCountryCodeTag(fourcc.svalue, value);
+        break;
     }
 }
 
@@ -268,16 +284,48 @@ void MP4SinkBase::writeLongTag(const std::string &key, const std::string &value)
                                   v, value.size(), type);
 }
 
+/* integer parses without sscanf's format string machinery */
+static bool parseInt(const std::string &s, long *result)
+{
+    char *endp;
+    long n = std::strtol(s.c_str(), &endp, 10);
+    if (endp == s.c_str())
+        return false;
+    *result = n;
+    return true;
+}
+
+static bool parseUInt(const std::string &s, unsigned *result)
+{
+    char *endp;
+    unsigned long n = std::strtoul(s.c_str(), &endp, 10);
+    if (endp == s.c_str())
+        return false;
+    *result = n;
+    return true;
+}
+
+static bool parseIntPair(const std::string &s, long *first, long *second)
+{
+    char *endp;
+    long n = std::strtol(s.c_str(), &endp, 10);
+    if (endp == s.c_str())
+        return false;
+    *first = n;
+    *second = *endp == '/' ? std::strtol(endp + 1, &endp, 10) : 0;
+    return true;
+}
+
 void MP4SinkBase::writeTrackTag(const char *fcc, const std::string &value)
 {
-    int n, total = 0;
-    if (std::sscanf(value.c_str(), "%d/%d", &n, &total) > 0)
+    long n, total;
+    if (parseIntPair(value, &n, &total))
         m_mp4file.SetMetadataTrack(n, total);
 }
 void MP4SinkBase::writeDiskTag(const char *fcc, const std::string &value)
 {
-    int n, total = 0;
-    if (std::sscanf(value.c_str(), "%d/%d", &n, &total) > 0)
+    long n, total;
+    if (parseIntPair(value, &n, &total))
         m_mp4file.SetMetadataDisk(n, total);
 }
 void MP4SinkBase::writeGenreTag(const char *fcc, const std::string &value)
@@ -297,53 +345,54 @@ void MP4SinkBase::writeGenreTag(const char *fcc, const std::string &value)
 void MP4SinkBase::writeMediaTypeTag(const char *fcc, const std::string &value)
 {
     unsigned n;
-    if (std::sscanf(value.c_str(), "%u", &n) != 1)
+    if (!parseUInt(value, &n))
         n = static_cast<uint8_t>(enumStikType.toType(value.c_str()));
     m_mp4file.SetMetadataUint8(fcc, n);
 }
 void MP4SinkBase::writeRatingTag(const char *fcc, const std::string &value)
 {
     unsigned n;
-    if (std::sscanf(value.c_str(), "%u", &n) != 1)
+    if (!parseUInt(value, &n))
         n = static_cast<uint8_t>(enumContentRating.toType(value.c_str()));
     m_mp4file.SetMetadataUint8(fcc, n);
 }
 void MP4SinkBase::writeAccountTypeTag(const char *fcc, const std::string &value)
 {
     unsigned n;
-    if (std::sscanf(value.c_str(), "%u", &n) != 1)
+    if (!parseUInt(value, &n))
         n = static_cast<uint8_t>(enumAccountType.toType(value.c_str()));
     m_mp4file.SetMetadataUint8(fcc, n);
 }
 void MP4SinkBase::writeCountryCodeTag(const char *fcc, const std::string &value)
 {
     unsigned n;
-    if (std::sscanf(value.c_str(), "%u", &n) != 1)
+    if (!parseUInt(value, &n))
         n = static_cast<uint32_t>(enumCountryCode.toType(value.c_str()));
     m_mp4file.SetMetadataUint32(fcc, n);
 }
 void MP4SinkBase::writeInt8Tag(const char *fcc, const std::string &value)
 {
-    int n;
-    if (std::sscanf(value.c_str(), "%d", &n) == 1)
+    long n;
+    if (parseInt(value, &n))
         m_mp4file.SetMetadataUint8(fcc, n);
 }
 void MP4SinkBase::writeInt16Tag(const char *fcc, const std::string &value)
 {
-    int n;
-    if (std::sscanf(value.c_str(), "%d", &n) == 1)
+    long n;
+    if (parseInt(value, &n))
         m_mp4file.SetMetadataUint16(fcc, n);
 }
 void MP4SinkBase::writeInt32Tag(const char *fcc, const std::string &value)
 {
-    int n;
-    if (std::sscanf(value.c_str(), "%d", &n) == 1)
+    long n;
+    if (parseInt(value, &n))
         m_mp4file.SetMetadataUint32(fcc, n);
 }
 void MP4SinkBase::writeInt64Tag(const char *fcc, const std::string &value)
 {
-    int64_t n;
-    if (std::sscanf(value.c_str(), "%lld", &n) == 1)
+    char *endp;
+    int64_t n = _strtoi64(value.c_str(), &endp, 10);
+    if (endp != value.c_str())
         m_mp4file.SetMetadataUint64(fcc, n);
 }
 void MP4SinkBase::writeStringTag(const char *fcc, const std::string &value)
@@ -390,6 +439,32 @@ MP4Sink::MP4Sink(const std::wstring &path,
     }
 }
 
+static char *put_hex32(char *p, uint32_t n)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (int i = 28; i >= 0; i -= 4)
+        *p++ = hex[(n >> i) & 0xf];
+    return p;
+}
+
+/*
+ * The iTunSMPB payload is a fixed layout of 8-digit hex fields; poke
+ * the three variable fields into a template instead of going through
+ * the printf machinery (and its locale handling).
+ */
+static std::string format_itunsmpb(uint32_t priming, uint32_t padding,
+                                   uint64_t duration)
+{
+    char buf[] = " 00000000 00000000 00000000 0000000000000000 "
+                 "00000000 00000000 00000000 00000000 00000000 "
+                 "00000000 00000000 00000000";
+    put_hex32(buf + 10, priming);
+    put_hex32(buf + 19, padding);
+    put_hex32(buf + 28, uint32_t(duration >> 32));
+    put_hex32(buf + 36, uint32_t(duration & 0xffffffff));
+    return std::string(buf, sizeof(buf) - 1);
+}
+
 void MP4Sink::writeTags()
 {
     MP4TrackId tid = m_mp4file.FindTrackId(0);
@@ -398,13 +473,11 @@ void MP4Sink::writeTags()
         uint64_t duration = m_mp4file.GetTrack(tid)->GetDuration();
 
         if (m_gapless_mode & MODE_ITUNSMPB) {
-            std::string value =
-                strutil::format(iTunSMPB_template,
-                m_edit_start,
-                uint32_t(duration - m_edit_start - m_edit_duration),
-                uint32_t(m_edit_duration >> 32),
-                uint32_t(m_edit_duration & 0xffffffff));
-            m_tags["iTunSMPB"] = value;
+            m_tags["iTunSMPB"] =
+                format_itunsmpb(m_edit_start,
+                                uint32_t(duration - m_edit_start
+                                         - m_edit_duration),
+                                m_edit_duration);
         }
         if (m_gapless_mode & MODE_EDTS) {
             MP4EditId eid = m_mp4file.AddTrackEdit(tid);
@@ -452,6 +525,32 @@ ADTSSink::ADTSSink(const std::shared_ptr<FILE> &fp,
 
 void ADTSSink::writeSamples(const void *data, size_t length, size_t nsamples)
 {
+    /*
+     * Everything but frame_length is invariant per stream, so just OR
+     * the length into the precomputed template and store big-endian.
+     */
+    uint64_t hdr = m_adts_template
+        | (uint64_t((length + m_pce_data.size() + 7) & 0x1fff) << 13);
+    hdr = util::h2big64(hdr << 8);
+
+    /* header + PCE + payload coalesced into a single write() */
+    size_t total = 7 + m_pce_data.size() + length;
+    if (m_frame_buf.size() < total)
+        m_frame_buf.resize(total);
+    std::memcpy(&m_frame_buf[0], &hdr, 7);
+    if (m_pce_data.size())
+        std::memcpy(&m_frame_buf[7], &m_pce_data[0], m_pce_data.size());
+    std::memcpy(&m_frame_buf[7 + m_pce_data.size()], data, length);
+    write(&m_frame_buf[0], total);
+}
+
+void ADTSSink::init(const std::vector<uint8_t> &config)
+{
+    m_seekable = win32::is_seekable(fileno(m_fp.get()));
+    unsigned rate;
+    size_t off = parseDecSpecificConfig(config, &m_sample_rate_index, &rate,
+                                        &m_channel_config);
+
     BitStream bs;
     bs.put(0xfff, 12); // syncword
     bs.put(0, 1);  // ID(MPEG identifier). 0 for MPEG4, 1 for MPEG2
@@ -467,23 +566,13 @@ void ADTSSink::writeSamples(const void *data, size_t length, size_t nsamples)
                    * copyright_identification_bit: 1
                    * copyright_identification_start: 1
                    */
-    bs.put(length + m_pce_data.size() + 7, 13); // frame_length
+    bs.put(0, 13); // frame_length, patched in per frame
     bs.put(0x7ff, 11); // adts_buffer_fullness, 0x7ff for VBR
     bs.put(0, 2); // number_of_raw_data_blocks_in_frame
     bs.byteAlign();
-
-    write(bs.data(), 7);
-    if (m_pce_data.size())
-        write(&m_pce_data[0], m_pce_data.size());
-    write(data, length);
-}
-
-void ADTSSink::init(const std::vector<uint8_t> &config)
-{
-    m_seekable = win32::is_seekable(fileno(m_fp.get()));
-    unsigned rate;
-    size_t off = parseDecSpecificConfig(config, &m_sample_rate_index, &rate,
-                                        &m_channel_config);
+    m_adts_template = 0;
+    for (size_t i = 0; i < 7; ++i)
+        m_adts_template = (m_adts_template << 8) | bs.data()[i];
 
     /* keep program config element stored in GASpecificConfig */
     if (m_channel_config == 0 && config.size() * 8 > off) {
@@ -114,8 +114,12 @@ class ADTSSink: public ISink {
     file_ptr_t m_fp;
     uint32_t m_sample_rate_index;
     uint32_t m_channel_config;
+    /* 56-bit ADTS header with frame_length zeroed, patched per frame */
+    uint64_t m_adts_template;
     bool m_seekable;
     std::vector<uint8_t> m_pce_data;
+    /* reusable bounce buffer so each frame goes out in one write() */
+    std::vector<uint8_t> m_frame_buf;
 public:
     ADTSSink(const std::wstring &path, const std::vector<uint8_t> &cookie,
              bool append=false);
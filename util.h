@@ -66,6 +66,12 @@ namespace util {
         }
         T *write_ptr() { return &m_data[m_end]; }
         void commit(size_t n) { m_end += n * m_unit; }
+        /* pre-size the backing store so that reserve() never reallocates */
+        void reserve_capacity(size_t n)
+        {
+            if (m_data.size() < n * m_unit)
+                m_data.resize(n * m_unit);
+        }
         void reserve(size_t n)
         {
             if (m_begin == m_end)
@@ -164,6 +170,10 @@ namespace util {
     {
         return _byteswap_ulong(n);
     }
+    inline uint64_t h2big64(uint64_t n)
+    {
+        return _byteswap_uint64(n);
+    }
 
     void bswapbuffer(void *buffer, size_t size, uint32_t width);
 